@@ -9,8 +9,22 @@
 
 #include <iostream>
 #include <fstream>
+#include <iomanip>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <ctime>
+#include <climits>
+#include <cmath>
+
+#ifdef _WIN32
+// Uses the kernel32 memory counters so psapi does not need linking
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 using namespace std;
 
@@ -41,14 +55,187 @@ typedef struct{
     char format;
 } mips_template;
 
+// Decoded instruction, the id indexes the instruction table
+typedef struct{
+    unsigned char id;
+    unsigned char rs;
+    unsigned char rt;
+    unsigned char rd;
+
+    // Immediate for I format, target address for J format
+    int immed;
+} decoded_inst;
+
+// Machine state that is not held in the registers
+typedef struct{
+    vector<int> dataVec;
+    int numInst;
+    int numData;
+
+    // Current instruction and the one to execute after it
+    int pc;
+    int nextPc;
+
+    bool halted;
+
+    // Instructions and syscalls executed
+    long long retired;
+    long long syscalls;
+} machine_state;
+
+// Prints a decoded instruction to the given stream
+typedef void (*print_fn)(ostream &out, const char *name, const decoded_inst &inst);
+
+// Describes one supported instruction, executed under an instrumentation policy
+template<class Policy>
+struct inst_desc{
+    const char *name;
+    char format;
+    unsigned opcode;
+    unsigned funct;
+    void (*exec)(const decoded_inst &inst, machine_state &state, Policy &hooks);
+    print_fn print;
+};
+
+// Instrumentation hook interface. The simulation loop is a template on the
+// policy, so hooks a policy does not hide are empty and compile away.
+struct no_instrumentation{
+    // Called before each instruction, returning false stops the simulation
+    bool preInst(const decoded_inst &inst, const machine_state &state) { return true; }
+
+    // Called after each instruction that does not exit the simulation
+    void postInst(const decoded_inst &inst, const machine_state &state) {}
+
+    // Called on each load and store with the data address and value
+    void memRead(const machine_state &state, int address, int value) {}
+    void memWrite(const machine_state &state, int address, int value) {}
+
+    // Called on each syscall with the $v0 value
+    void syscall(const machine_state &state, int v0Val) {}
+
+    // Called once the simulation ends
+    void finish(const machine_state &state) {}
+};
+
+// Instrumentation selected on the command line
+enum inst_mode {MODE_NONE, MODE_COUNT, MODE_TRACE, MODE_DEBUG};
+
+// Command line options following the object file
+typedef struct{
+    inst_mode mode;
+
+    // Debugging breakpoints and watchpoints
+    vector<int> breakpoints;
+    vector<unsigned> watchRegs;
+    vector<int> watchData;
+
+    // Prints run statistics as JSON
+    bool stats;
+
+    // Detailed sample windows of sampleWindow instructions in every
+    // samplePeriod, 0 simulates every instruction in detail
+    long long samplePeriod;
+    long long sampleWindow;
+} sim_options;
+
+// Wall and CPU seconds spent in a phase
+typedef struct{
+    double wall;
+    double cpu;
+} phase_time;
+
+// Clock samples taken at the start of a phase
+typedef struct{
+    chrono::steady_clock::time_point wall;
+    double cpu;
+} phase_timer;
+
+// Host side statistics for --stats
+typedef struct{
+    bool enabled;
+
+    phase_time load;
+    phase_time decode;
+    phase_time listing;
+    phase_time simulate;
+
+    // Wall seconds of the simulation spent printing to the log
+    double logWall;
+
+    // Wall seconds of the simulation spent waiting for syscall input
+    double inputWall;
+
+    long long retired;
+    long long syscalls;
+
+    // Size of log.txt, -1 if it could not be written
+    long long logBytes;
+
+    // Phase being timed, stopped at exit if the simulator fails in it
+    phase_time *phase;
+    phase_timer timer;
+
+    // Machine being simulated, read at exit if the simulator fails
+    const machine_state *machine;
+
+    // -1 until main returns
+    int exitStatus;
+} run_stats;
+
+// Measurements of the detailed windows of a sampled run
+typedef struct{
+    long long period;
+    long long window;
+
+    // Instructions executed in detailed windows
+    long long detailed;
+
+    // Instructions, log bytes, wall seconds and count of each kind of
+    // instruction in each full window
+    vector<double> windowInst;
+    vector<double> logBytes;
+    vector<double> wall;
+    vector<vector<double>> instCount;
+
+    // The window the run ended in is cut short and always includes the
+    // exit, so it is added exactly rather than sampled
+    double lastInst;
+    double lastLogBytes;
+    double lastWall;
+    vector<double> lastInstCount;
+
+    // Log listing written before the simulation
+    double headerBytes;
+} sample_stats;
+
+// Whole run value extrapolated from the sample windows
+typedef struct{
+    double value;
+
+    // 95% confidence bound, unknown with fewer than two windows
+    double bound;
+    bool boundKnown;
+} sample_estimate;
+
+// Register numbers used directly by the simulator
+const unsigned REG_ZERO = 0;
+const unsigned REG_V0 = 2;
+const unsigned REG_A0 = 4;
+const unsigned REG_GP = 28;
+const unsigned REG_LO = 32;
+const unsigned REG_HI = 33;
+
+// Initializes the output stream
+ofstream fout;
+
 // Correlates the register decimal value to the register
 string registerTable(unsigned int registerDec);
 
 // Prints the registers and their values.
 void printRegs(vector<pair<string, int>> regs);
 
-// Formats and prints the given instruction to the output file
-void printInst(vector<string> inst);
+// Formats and prints the given instruction, to the output file by default
+void printInst(const decoded_inst &inst, ostream &out = fout);
 
 // Prints data, formated for the initial log output
 void printData(vector<int> dataVec, int numInst);
@@ -57,16 +244,167 @@ void printData(vector<int> dataVec, int numInst);
 void printAltData(vector<int> dataVec);
 
 // Sets register values
-void setReg(string regName, int regVal);
+void setReg(unsigned reg, int regVal);
 
 // Returns the register value
-int getRegVal(string regName);
+int getRegVal(unsigned reg);
+
+// Returns the CPU seconds used by the simulator
+double cpuSeconds();
+
+// Starts timing a phase
+void startPhase(phase_time &phase);
+
+// Adds the time since the phase started to it
+void stopPhase();
+
+// Prints the run statistics when the simulator exits, including on errors
+void printStatsAtExit();
+
+// Returns the peak memory use of the simulator in kilobytes
+long long peakMemoryKb();
+
+// Prints the run statistics as JSON
+void printStats(ostream &out);
+
+// Prints a sampling estimate as JSON or as a report line
+void printEstimate(ostream &out, const char *name, const sample_estimate &est);
+void printEstimateLine(ostream &out, const char *name, const sample_estimate &est, int precision);
+
+// Extrapolates a value totalled in each full window to the whole run,
+// adding the part of it that is known exactly
+sample_estimate estimate(const vector<double> &totals, double exact);
+
+// Returns the count of one instruction in each full window
+vector<double> windowCounts(int id);
+
+// Returns the number of windows, including the one the run ended in
+int numWindows();
+
+// Prints the estimates of a sampled run
+void printSampling(ostream &out);
+
+// Parses the command line options, exits if one is invalid
+void parseOptions(int argc, char *argv[], sim_options &opts);
 
 // Decodes a vector of hex instructions
-void decode(vector<mips_template> hexInst, vector<vector<string>> &decodedInst);
+void decode(vector<mips_template> hexInst, vector<decoded_inst> &decodedInst);
+
+// Simulates a list of decoded instructions under an instrumentation policy
+template<class Policy>
+void simulate(vector<decoded_inst> decodedInst, vector<int> dataVec, int numInst, int numData, Policy &hooks);
+
+// Runs up to count instructions, in detailed or functional mode
+template<bool Detailed, class Policy>
+void run(const vector<decoded_inst> &decodedInst, machine_state &state, Policy &hooks, long long count);
+
+// Runs with detailed sample windows and functional mode in between
+template<class Policy>
+void sample(const vector<decoded_inst> &decodedInst, machine_state &state, Policy &hooks);
+
+// Instruction handlers
+template<class Policy> void execSyscall(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execMfhi(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execMflo(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execMult(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execDiv(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execAddu(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execSubu(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execAnd(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execOr(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execSlt(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execJ(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execBeq(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execBne(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execAddiu(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execLw(const decoded_inst &inst, machine_state &state, Policy &hooks);
+template<class Policy> void execSw(const decoded_inst &inst, machine_state &state, Policy &hooks);
+
+// Disassembly formatters, named after the operand order they print
+void printNone(ostream &out, const char *name, const decoded_inst &inst);
+void printRd(ostream &out, const char *name, const decoded_inst &inst);
+void printRsRt(ostream &out, const char *name, const decoded_inst &inst);
+void printRdRsRt(ostream &out, const char *name, const decoded_inst &inst);
+void printRsRtImmed(ostream &out, const char *name, const decoded_inst &inst);
+void printRtRsImmed(ostream &out, const char *name, const decoded_inst &inst);
+void printRtImmedRs(ostream &out, const char *name, const decoded_inst &inst);
+void printTarget(ostream &out, const char *name, const decoded_inst &inst);
+
+// Every supported instruction. Decoding, execution and printing are all
+// driven from this table, so adding an instruction only means adding a row.
+template<class Policy>
+struct instructions{
+    static constexpr inst_desc<Policy> table[] = {
+        {"syscall", 'R',  0, 12, execSyscall<Policy>, printNone},
+        {"mfhi",    'R',  0, 16, execMfhi<Policy>,    printRd},
+        {"mflo",    'R',  0, 18, execMflo<Policy>,    printRd},
+        {"mult",    'R',  0, 24, execMult<Policy>,    printRsRt},
+        {"div",     'R',  0, 26, execDiv<Policy>,     printRsRt},
+        {"addu",    'R',  0, 33, execAddu<Policy>,    printRdRsRt},
+        {"subu",    'R',  0, 35, execSubu<Policy>,    printRdRsRt},
+        {"and",     'R',  0, 36, execAnd<Policy>,     printRdRsRt},
+        {"or",      'R',  0, 37, execOr<Policy>,      printRdRsRt},
+        {"slt",     'R',  0, 42, execSlt<Policy>,     printRdRsRt},
+        {"j",       'J',  2,  0, execJ<Policy>,       printTarget},
+        {"beq",     'I',  4,  0, execBeq<Policy>,     printRsRtImmed},
+        {"bne",     'I',  5,  0, execBne<Policy>,     printRsRtImmed},
+        {"addiu",   'I',  9,  0, execAddiu<Policy>,   printRtRsImmed},
+        {"lw",      'I', 35,  0, execLw<Policy>,      printRtImmedRs},
+        {"sw",      'I', 43,  0, execSw<Policy>,      printRtImmedRs},
+    };
+};
+
+template<class Policy>
+constexpr inst_desc<Policy> instructions<Policy>::table[];
+
+// Instruction table for everything that does not depend on the policy
+typedef instructions<no_instrumentation> inst_info;
+
+constexpr unsigned NUM_INSTS = sizeof(inst_info::table) / sizeof(inst_info::table[0]);
+
+// Marks an opcode/function pair with no instruction
+constexpr unsigned char INVALID_INST = 0xff;
+
+// Number of decode keys, one per I/J opcode plus one per R function
+constexpr unsigned NUM_DECODE_KEYS = 128;
+
+// R format instructions are keyed by function, the rest by opcode
+constexpr unsigned decodeKey(unsigned opcode, unsigned funct) {
+    return opcode == 0 ? 64 + funct : opcode;
+}
+
+// Returns the table index of the instruction with the given key
+constexpr unsigned char findInst(unsigned key, unsigned i) {
+    return i == NUM_INSTS ? INVALID_INST
+        : decodeKey(inst_info::table[i].opcode, inst_info::table[i].funct) == key ? i
+        : findInst(key, i + 1);
+}
 
-// Simulates a list of decoded instructions
-void simulate(vector<vector<string>> decodedInst, vector<int> dataVec, int numInst, int numData);
+// Checks that no two instructions share a key
+constexpr bool uniqueKeys(unsigned i) {
+    return i == NUM_INSTS ? true
+        : findInst(decodeKey(inst_info::table[i].opcode, inst_info::table[i].funct), 0) == i && uniqueKeys(i + 1);
+}
+
+static_assert(NUM_INSTS < INVALID_INST, "Too many instructions for the decode table");
+static_assert(uniqueKeys(0), "Duplicate opcode/function in the instruction table");
+
+// Compile time list of decode keys
+template<unsigned... Keys> struct key_seq {};
+template<unsigned N, unsigned... Keys> struct make_key_seq : make_key_seq<N - 1, N - 1, Keys...> {};
+template<unsigned... Keys> struct make_key_seq<0, Keys...> { typedef key_seq<Keys...> type; };
+
+// Maps a decode key to its instruction table index
+typedef struct{
+    unsigned char id[NUM_DECODE_KEYS];
+} decode_table;
+
+template<unsigned... Keys>
+constexpr decode_table makeDecodeTable(key_seq<Keys...>) {
+    return {{findInst(Keys, 0)...}};
+}
+
+constexpr decode_table decodeTable = makeDecodeTable(make_key_seq<NUM_DECODE_KEYS>::type());
 
 // Holds all register values.
 vector<pair<string, int>> regs = {{"$zero", 0}, {"$at", 0}, {"$v0", 0}, {"$v1", 0},
@@ -79,20 +417,188 @@ vector<pair<string, int>> regs = {{"$zero", 0}, {"$at", 0}, {"$v0", 0}, {"$v1",
                         {"$gp", 0}, {"$sp", 0}, {"$fp", 0}, {"$ra", 0},
                         {"$lo", 0}, {"$hi", 0}};
 
-// Initializes the output stream
-ofstream fout;
+// Statistics of this run
+run_stats stats = {};
+
+// Sample windows of this run
+sample_stats sampling = {};
+
+// Counts executed instructions, memory accesses and syscalls
+struct counting_instrumentation : no_instrumentation{
+    long long instCount[NUM_INSTS];
+    long long total;
+    long long reads;
+    long long writes;
+    long long syscalls;
+
+    counting_instrumentation() : total(0), reads(0), writes(0), syscalls(0) {
+        for(int i = 0; i < NUM_INSTS; i++) {
+            instCount[i] = 0;
+        }
+    }
+
+    bool preInst(const decoded_inst &inst, const machine_state &state) {
+        ++instCount[inst.id];
+        ++total;
+        return true;
+    }
+
+    void memRead(const machine_state &state, int address, int value) { ++reads; }
+    void memWrite(const machine_state &state, int address, int value) { ++writes; }
+    void syscall(const machine_state &state, int v0Val) { ++syscalls; }
+
+    // Prints the counts
+    void finish(const machine_state &state) {
+        cerr << "Instructions executed: " << state.retired << endl;
+
+        // When sampling, only the detailed windows are counted
+        if(total != state.retired) {
+            cerr << "Counted in sample windows: " << total << endl;
+        }
+        for(int i = 0; i < NUM_INSTS; i++) {
+            if(instCount[i] != 0) {
+                cerr.width(10);
+                cerr << left << inst_info::table[i].name << instCount[i] << endl;
+            }
+        }
+        if(total != state.retired) {
+            cerr << "In sample windows, ";
+        }
+        cerr << "Loads: " << reads << " Stores: " << writes << " Syscalls: " << syscalls << endl;
+    }
+};
+
+// Prints each instruction, memory access and syscall to stderr
+struct tracing_instrumentation : no_instrumentation{
+    bool preInst(const decoded_inst &inst, const machine_state &state) {
+        cerr << "PC " << state.pc << ": ";
+        printInst(inst, cerr);
+        return true;
+    }
+
+    void memRead(const machine_state &state, int address, int value) {
+        cerr << "  read " << address << " = " << value << endl;
+    }
+
+    void memWrite(const machine_state &state, int address, int value) {
+        cerr << "  write " << address << " = " << value << endl;
+    }
+
+    void syscall(const machine_state &state, int v0Val) {
+        cerr << "  syscall " << v0Val << endl;
+    }
+};
+
+// Stops at breakpoints and reports changes to watched registers and data
+struct debugging_instrumentation : no_instrumentation{
+    vector<int> breakpoints;
+    vector<unsigned> watchRegs;
+    vector<int> watchData;
+
+    // Watched register values before the current instruction
+    vector<int> oldRegs;
+
+    debugging_instrumentation(const sim_options &opts) : breakpoints(opts.breakpoints),
+        watchRegs(opts.watchRegs), watchData(opts.watchData), oldRegs(opts.watchRegs.size()) {}
+
+    bool preInst(const decoded_inst &inst, const machine_state &state) {
+        for(int i = 0; i < breakpoints.size(); i++) {
+            if(breakpoints[i] == state.pc) {
+                cerr << "Breakpoint at PC " << state.pc << endl;
+                fout << "breakpoint" << endl;
+                return false;
+            }
+        }
+        for(int i = 0; i < watchRegs.size(); i++) {
+            oldRegs[i] = getRegVal(watchRegs[i]);
+        }
+        return true;
+    }
+
+    void postInst(const decoded_inst &inst, const machine_state &state) {
+        for(int i = 0; i < watchRegs.size(); i++) {
+            int newVal = getRegVal(watchRegs[i]);
+            if(newVal != oldRegs[i]) {
+                cerr << "Watch " << regs[watchRegs[i]].first << ": " << oldRegs[i]
+                     << " -> " << newVal << " at PC " << state.pc << endl;
+            }
+        }
+    }
+
+    void memRead(const machine_state &state, int address, int value) {
+        watchAccess(state, "read", address, value);
+    }
+
+    void memWrite(const machine_state &state, int address, int value) {
+        watchAccess(state, "written", address, value);
+    }
+
+    // Reports an access to a watched data address
+    void watchAccess(const machine_state &state, const char *access, int address, int value) {
+        for(int i = 0; i < watchData.size(); i++) {
+            if(watchData[i] == address) {
+                cerr << "Watch data " << address << " " << access << ": " << value
+                     << " at PC " << state.pc << endl;
+            }
+        }
+    }
+};
+
+// Used for the detailed windows of a sampled run. Forwards the hooks to the
+// run's policy and counts each kind of instruction in the current window.
+template<class Policy>
+struct sampling_instrumentation : no_instrumentation{
+    Policy &hooks;
+    long long instCount[NUM_INSTS];
+
+    sampling_instrumentation(Policy &hooks) : hooks(hooks) {
+        startWindow();
+    }
+
+    void startWindow() {
+        for(int i = 0; i < NUM_INSTS; i++) {
+            instCount[i] = 0;
+        }
+    }
+
+    bool preInst(const decoded_inst &inst, const machine_state &state) {
+        if(!hooks.preInst(inst, state)) {
+            return false;
+        }
+        ++instCount[inst.id];
+        return true;
+    }
+
+    void postInst(const decoded_inst &inst, const machine_state &state) { hooks.postInst(inst, state); }
+    void memRead(const machine_state &state, int address, int value) { hooks.memRead(state, address, value); }
+    void memWrite(const machine_state &state, int address, int value) { hooks.memWrite(state, address, value); }
+    void syscall(const machine_state &state, int v0Val) { hooks.syscall(state, v0Val); }
+};
 
 int main(int argc, char *argv[]) {
+    stats.exitStatus = -1;
+    startPhase(stats.load);
+
+    // Options following the object file
+    sim_options opts;
+    parseOptions(argc, argv, opts);
+    stats.enabled = opts.stats;
+    if(stats.enabled) {
+        atexit(printStatsAtExit);
+    }
+    sampling.period = opts.samplePeriod;
+    sampling.window = opts.sampleWindow;
+    sampling.lastInstCount.assign(NUM_INSTS, 0);
 
     // Vector for hex instructions.
     vector<mips_template> hexInst;
 
     // Decoded instructions
-    vector<vector<string>> decodedInst;
+    vector<decoded_inst> decodedInst;
 
     // Vector for data.
     vector<int> dataVec;
-    
+
     // Sets input/output streams
     fout.open("log.txt");
     ifstream fin(argv[1]);
@@ -104,7 +610,7 @@ int main(int argc, char *argv[]) {
     sscanf(firstLine.c_str(), "%d %d", &numInst, &numData);
 
     // Sets the global pointer
-    setReg("$gp", numInst);
+    setReg(REG_GP, numInst);
 
     // Stores the input
     string line;
@@ -128,8 +634,13 @@ int main(int argc, char *argv[]) {
             exit(-1);
         dataVec.push_back(val);
     }
+    stopPhase();
 
+    startPhase(stats.decode);
     decode(hexInst, decodedInst);
+    stopPhase();
+
+    startPhase(stats.listing);
 
     // Prints all of the instructions
     fout << "insts:" << endl;
@@ -142,395 +653,719 @@ int main(int argc, char *argv[]) {
     fout << "\n";
 
     printData(dataVec, numInst);
-    simulate(decodedInst, dataVec, numInst, numData);
+    stopPhase();
+
+    startPhase(stats.simulate);
+
+    // Chooses the instrumentation once, the simulation loop is compiled for each
+    if(opts.mode == MODE_COUNT) {
+        counting_instrumentation hooks;
+        simulate(decodedInst, dataVec, numInst, numData, hooks);
+    }
+    else if(opts.mode == MODE_TRACE) {
+        tracing_instrumentation hooks;
+        simulate(decodedInst, dataVec, numInst, numData, hooks);
+    }
+    else if(opts.mode == MODE_DEBUG) {
+        debugging_instrumentation hooks(opts);
+        simulate(decodedInst, dataVec, numInst, numData, hooks);
+    }
+    else {
+        no_instrumentation hooks;
+        simulate(decodedInst, dataVec, numInst, numData, hooks);
+    }
+    stopPhase();
 
+    stats.logBytes = fout ? (long long)fout.tellp() : -1;
     fout.close();
 
+    stats.exitStatus = 0;
     return 0;
 }
 
-// Decodes the instruction
-void decode(vector<mips_template> hexInst, vector<vector<string>> &decodedInst) {
-    string stringRs;
-    string stringRt;
-    string stringRd;
-    string stringImmed;
-    
-    // Converts hex instructions into regular instructions.
-    for(int i = 0; i < hexInst.size(); i++) {
-
-        // R format
-        if(hexInst[i].u.rformat.opcode == 0) {
+// Parses the options
+void parseOptions(int argc, char *argv[], sim_options &opts) {
+    opts.mode = MODE_NONE;
+    opts.stats = false;
+    opts.samplePeriod = 0;
+    opts.sampleWindow = 0;
 
-            // Syscall
-            if(hexInst[i].u.rformat.funct == 12){
-                decodedInst.push_back({"syscall"});
-            }
-            // Mfhi
-            else if(hexInst[i].u.rformat.funct == 16) {
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+    for(int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        inst_mode mode;
+        int val;
 
-                decodedInst.push_back({"mfhi", stringRd});
-            }
-            // Mflo
-            else if(hexInst[i].u.rformat.funct == 18) {
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+        // Statistics can be combined with any instrumentation
+        if(arg == "--stats=json") {
+            opts.stats = true;
+            continue;
+        }
 
-                decodedInst.push_back({"mflo", stringRd});
+        // So can sampling, which applies it to the detailed windows only
+        if(arg.compare(0, 9, "--sample=") == 0) {
+            if(sscanf(argv[i], "--sample=%lld:%lld", &opts.samplePeriod, &opts.sampleWindow) != 2 ||
+               opts.sampleWindow <= 0 || opts.samplePeriod < opts.sampleWindow) {
+                cout << "Invalid option: " << arg << endl;
+                exit(-1);
             }
-            // Mult
-            else if(hexInst[i].u.rformat.funct == 24) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
+            continue;
+        }
 
-                decodedInst.push_back({"mult", stringRs, stringRt});
+        if(arg == "--count") {
+            mode = MODE_COUNT;
+        }
+        else if(arg == "--trace") {
+            mode = MODE_TRACE;
+        }
+        else if(sscanf(argv[i], "--break=%d", &val) == 1) {
+            mode = MODE_DEBUG;
+            opts.breakpoints.push_back(val);
+        }
+        else if(sscanf(argv[i], "--watch-data=%d", &val) == 1) {
+            mode = MODE_DEBUG;
+            opts.watchData.push_back(val);
+        }
+        else if(arg.compare(0, 12, "--watch-reg=") == 0) {
+            mode = MODE_DEBUG;
+
+            // Finds the register by name
+            string regName = arg.substr(12);
+            unsigned reg = 0;
+            while(reg < regs.size() && regs[reg].first != regName) {
+                reg++;
             }
-            // Div
-            else if(hexInst[i].u.rformat.funct == 26) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
-
-                decodedInst.push_back({"div", stringRs, stringRt});
+            if(reg == regs.size()) {
+                cout << "Invalid register" << endl;
+                exit(-1);
             }
-            // Addu
-            else if(hexInst[i].u.rformat.funct == 33) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+            opts.watchRegs.push_back(reg);
+        }
+        else {
+            cout << "Invalid option: " << arg << endl;
+            exit(-1);
+        }
 
-                decodedInst.push_back({"addu", stringRd, stringRs, stringRt});
-            }
-            // Subu
-            else if(hexInst[i].u.rformat.funct == 35) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+        // Only one kind of instrumentation runs at a time
+        if(opts.mode != MODE_NONE && opts.mode != mode) {
+            cout << "Invalid option: " << arg << endl;
+            exit(-1);
+        }
+        opts.mode = mode;
+    }
 
-                decodedInst.push_back({"subu", stringRd, stringRs, stringRt});
-            }
-            // And
-            else if(hexInst[i].u.rformat.funct == 36) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+    // Breakpoints and watchpoints would be missed outside the sample windows
+    if(opts.samplePeriod != 0 && opts.mode == MODE_DEBUG) {
+        cout << "Invalid option: --sample cannot be used with breakpoints or watchpoints" << endl;
+        exit(-1);
+    }
+}
 
-                decodedInst.push_back({"and", stringRd, stringRs, stringRt});
-            }
-            // Or
-            else if(hexInst[i].u.rformat.funct == 37) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+// Decodes the instruction
+void decode(vector<mips_template> hexInst, vector<decoded_inst> &decodedInst) {
 
-                decodedInst.push_back({"or", stringRd, stringRs, stringRt});
-            }
-            // Slt
-            else if(hexInst[i].u.rformat.funct == 42) {
-                stringRs = registerTable(hexInst[i].u.rformat.rs);
-                stringRt = registerTable(hexInst[i].u.rformat.rt);
-                stringRd = registerTable(hexInst[i].u.rformat.rd);
+    // Converts hex instructions into regular instructions.
+    for(int i = 0; i < hexInst.size(); i++) {
+        unsigned opcode = hexInst[i].u.rformat.opcode;
+        unsigned char id = decodeTable.id[decodeKey(opcode, hexInst[i].u.rformat.funct)];
 
-                decodedInst.push_back({"slt", stringRd, stringRs, stringRt});
+        // Invalid opcode
+        if(id == INVALID_INST) {
+            if(opcode == 0) {
+                cout << "Invalid Opcode/Function Line: " << i+1 << endl;
             }
-            // Invalid opcode
             else {
-                stringImmed = to_string(hexInst[i].u.rformat.funct);
-                cout << "Invalid Opcode/Function Line: " << i+1 << endl;
-                exit(-1);
+                cout << "Invalid Opcode Line: " << i+1 << endl;
             }
+            exit(-1);
         }
 
-        // J format
-        if(hexInst[i].u.jformat.opcode == 2) {
-            stringImmed = to_string(hexInst[i].u.jformat.address);
-            decodedInst.push_back({"j", stringImmed});
+        decoded_inst inst;
+        inst.id = id;
+        inst.rs = hexInst[i].u.rformat.rs;
+        inst.rt = hexInst[i].u.rformat.rt;
+        inst.rd = hexInst[i].u.rformat.rd;
+
+        if(inst_info::table[id].format == 'J') {
+            inst.immed = hexInst[i].u.jformat.address;
+        }
+        else {
+            inst.immed = hexInst[i].u.iformat.immed;
         }
 
-        // I format
-        if(hexInst[i].u.iformat.opcode > 3) {
+        decodedInst.push_back(inst);
+    }
+}
 
-            // Beq
-            if(hexInst[i].u.iformat.opcode == 4){
-                stringRs = registerTable(hexInst[i].u.iformat.rs);
-                stringRt = registerTable(hexInst[i].u.iformat.rt);
-                stringImmed = to_string(hexInst[i].u.iformat.immed);
+// Simulates the decoded instruction
+template<class Policy>
+void simulate(vector<decoded_inst> decodedInst, vector<int> dataVec, int numInst, int numData, Policy &hooks) {
+    machine_state state;
+    state.dataVec = dataVec;
+    state.numInst = numInst;
+    state.numData = numData;
+    state.pc = 0;
+    state.halted = false;
+    state.retired = 0;
+    state.syscalls = 0;
+    stats.machine = &state;
+
+    if(sampling.period == 0) {
+        run<true>(decodedInst, state, hooks, LLONG_MAX);
+    }
+    else {
+        sample(decodedInst, state, hooks);
+    }
 
-                decodedInst.push_back({"beq", stringRs, stringRt, stringImmed});
-            }
-            // Bne
-            else if(hexInst[i].u.iformat.opcode == 5){
-                stringRs = registerTable(hexInst[i].u.iformat.rs);
-                stringRt = registerTable(hexInst[i].u.iformat.rt);
-                stringImmed = to_string(hexInst[i].u.iformat.immed);
+    stats.machine = NULL;
+    stats.retired = state.retired;
+    stats.syscalls = state.syscalls;
 
-                decodedInst.push_back({"bne", stringRs, stringRt, stringImmed});
-            }
-            // Addiu
-            else if(hexInst[i].u.iformat.opcode == 9){
-                stringRt = registerTable(hexInst[i].u.iformat.rt);
-                stringRs = registerTable(hexInst[i].u.iformat.rs);
-                stringImmed = to_string(hexInst[i].u.iformat.immed);
+    if(sampling.period != 0) {
+        printSampling(cerr);
+    }
+
+    hooks.finish(state);
+}
+
+// Runs up to count instructions, logging each one in detailed mode
+template<bool Detailed, class Policy>
+void run(const vector<decoded_inst> &decodedInst, machine_state &state, Policy &hooks, long long count) {
+
+    // Times spent printing to the log
+    chrono::steady_clock::time_point logStart;
 
-                decodedInst.push_back({"addiu", stringRt, stringRs, stringImmed});
+    // Simulation loop
+    for(long long i = 0; i < count && state.pc < state.numInst; i++){
+        const decoded_inst &inst = decodedInst[state.pc];
+
+        // Stops at a breakpoint
+        if(!hooks.preInst(inst, state)) {
+            state.halted = true;
+            break;
+        }
+
+        if(Detailed) {
+            if(stats.enabled) {
+                logStart = chrono::steady_clock::now();
             }
-            // Lw
-            else if(hexInst[i].u.iformat.opcode == 35){
-                stringRt = registerTable(hexInst[i].u.iformat.rt);
-                stringImmed = to_string(hexInst[i].u.iformat.immed);
-                stringRs = registerTable(hexInst[i].u.iformat.rs);
 
-                decodedInst.push_back({"lw", stringRt, stringImmed, stringRs});
+            fout << "PC: " << state.pc << endl;
+            fout << "inst: ";
+            printInst(inst);
+
+            if(stats.enabled) {
+                stats.logWall += chrono::duration<double>(chrono::steady_clock::now() - logStart).count();
             }
-            // Sw
-            else if(hexInst[i].u.iformat.opcode == 43){
-                stringRt = registerTable(hexInst[i].u.iformat.rt);
-                stringImmed = to_string(hexInst[i].u.iformat.immed);
-                stringRs = registerTable(hexInst[i].u.iformat.rs);
+        }
+
+        state.nextPc = state.pc + 1;
+        instructions<Policy>::table[inst.id].exec(inst, state, hooks);
+        ++state.retired;
+
+        // Exits the simulation
+        if(state.halted) {
+            break;
+        }
 
-                decodedInst.push_back({"sw", stringRt, stringImmed, stringRs});
+        hooks.postInst(inst, state);
+
+        if(Detailed) {
+            if(stats.enabled) {
+                logStart = chrono::steady_clock::now();
             }
-            else {
-                cout << "Invalid Opcode Line: " << i+1 << endl;
-                exit(-1);
+
+            printRegs(regs);
+            printAltData(state.dataVec);
+
+            if(stats.enabled) {
+                stats.logWall += chrono::duration<double>(chrono::steady_clock::now() - logStart).count();
             }
         }
-        
+
+        state.pc = state.nextPc;
     }
 }
 
-// Simulates the decoded instruction
-void simulate(vector<vector<string>> decodedInst, vector<int> dataVec, int numInst, int numData) {
-    int intRs;
-    int intRt;
-    int intRd;
-    int intImmed;
-    int intAddress;
-
-    int quotient;
-    int remainder;
-    
-    // Simulation loop
-    for(int i = 0; i < numInst; i++){
-        fout << "PC: " << i << endl;
-        fout << "inst: ";
-        printInst(decodedInst[i]);
+// Alternates detailed windows with functional runs for the rest of each period
+template<class Policy>
+void sample(const vector<decoded_inst> &decodedInst, machine_state &state, Policy &hooks) {
+    sampling_instrumentation<Policy> detailedHooks(hooks);
+    no_instrumentation functionalHooks;
 
-        if(decodedInst[i][0] == "syscall") {
-            int v0Val = getRegVal("$v0");
-            
+    sampling.headerBytes = fout.tellp();
 
-            // Prints the $a0 register
-            if(v0Val == 1){
-                int a0Val = getRegVal("$a0");
-                cout << a0Val << endl;
-            }
-            // Sets $v0 register to the users input
-            else if(v0Val == 5) {
-                cout << "Syscall input: ";
-                cin >> v0Val;
-                setReg("$v0", v0Val);
-            }
-            // Exits the simulation
-            else if(v0Val == 10) {
-                fout << "exiting simulator" << endl;
-                break;
-            }
-            else {
-                cout << "Error: Invalid Syscall" << endl;
-                exit(-1);
-            }
+    while(!state.halted && state.pc < state.numInst) {
+        long long start = state.retired;
+        long long startBytes = fout.tellp();
+        chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+        double startInput = stats.inputWall;
+
+        detailedHooks.startWindow();
+        run<true>(decodedInst, state, detailedHooks, sampling.window);
+
+        // Records the window
+        long long windowInst = state.retired - start;
+        double logBytes = (long long)fout.tellp() - startBytes;
+
+        // Waiting for syscall input is not part of the window's time
+        double wall = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        wall -= stats.inputWall - startInput;
+
+        vector<double> counts(NUM_INSTS);
+        for(int i = 0; i < NUM_INSTS; i++) {
+            counts[i] = detailedHooks.instCount[i];
         }
-        else if(decodedInst[i][0] == "mfhi") {
-            // Saves the $hi register
-            intRd = getRegVal("$hi");
 
-            // Sets the target register to the $hi registers value
-            setReg(decodedInst[i][1], intRd);
+        sampling.detailed += windowInst;
+
+        if(state.halted || state.pc >= state.numInst) {
+            sampling.lastInst = windowInst;
+            sampling.lastLogBytes = logBytes;
+            sampling.lastWall = wall;
+            sampling.lastInstCount = counts;
+            break;
         }
-        else if(decodedInst[i][0] == "mflo") {
-            // Saves the $lo register
-            intRd = getRegVal("$lo");
 
-            // Sets the target register to the $lo registers value
-            setReg(decodedInst[i][1], intRd);
+        sampling.windowInst.push_back(windowInst);
+        sampling.logBytes.push_back(logBytes);
+        sampling.wall.push_back(wall);
+        sampling.instCount.push_back(counts);
+
+        start = state.retired;
+        run<false>(decodedInst, state, functionalHooks, sampling.period - sampling.window);
+
+        if(state.retired > start) {
+            fout << "skipped " << state.retired - start << " instructions" << "\n\n\n";
         }
-        else if(decodedInst[i][0] == "mult") {
-            long long product;
-            intRs = getRegVal(decodedInst[i][1]);
-            intRd = getRegVal(decodedInst[i][2]);
+    }
+}
 
-            product = (long long) intRs * (long long) intRd;
+template<class Policy>
+void execSyscall(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    int v0Val = getRegVal(REG_V0);
+    hooks.syscall(state, v0Val);
+    ++state.syscalls;
 
-            // intRs is the $lo register
-            intRs = (int)(product & 0xffffffff);
+    // Prints the $a0 register
+    if(v0Val == 1){
+        int a0Val = getRegVal(REG_A0);
+        cout << a0Val << endl;
+    }
+    // Sets $v0 register to the users input
+    else if(v0Val == 5) {
+        cout << "Syscall input: ";
 
-            // intRd is the $hi register
-            intRd = (int)((product >> 32) & 0xffffffff);
+        chrono::steady_clock::time_point inputStart = chrono::steady_clock::now();
+        cin >> v0Val;
+        stats.inputWall += chrono::duration<double>(chrono::steady_clock::now() - inputStart).count();
 
-            // Sets the $hi and $lo registers.
-            setReg("$lo", intRs);
-            setReg("$hi", intRd);
+        setReg(REG_V0, v0Val);
+    }
+    // Exits the simulation
+    else if(v0Val == 10) {
+        fout << "exiting simulator" << endl;
+        state.halted = true;
+    }
+    else {
+        cout << "Error: Invalid Syscall" << endl;
+        exit(-1);
+    }
+}
 
-        }
-        else if(decodedInst[i][0] == "div") {
+template<class Policy>
+void execMfhi(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    // Sets the target register to the $hi registers value
+    setReg(inst.rd, getRegVal(REG_HI));
+}
 
-            intRs = getRegVal(decodedInst[i][1]);
-            intRt = getRegVal(decodedInst[i][2]);
+template<class Policy>
+void execMflo(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    // Sets the target register to the $lo registers value
+    setReg(inst.rd, getRegVal(REG_LO));
+}
 
-            // If dividing by 0, error.
-            if(intRs == 0 || intRt == 0) {
-                cout << "Error: Cannot divide by 0 on PC " << i << endl;
-                exit(-1);
-            }
+template<class Policy>
+void execMult(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    long long product = (long long) getRegVal(inst.rs) * (long long) getRegVal(inst.rt);
 
-            // Gets the quotient and remainder.
-            quotient = (intRs/intRt);
-            remainder = (intRs%intRt);
+    // Sets the $hi and $lo registers.
+    setReg(REG_LO, (int)(product & 0xffffffff));
+    setReg(REG_HI, (int)((product >> 32) & 0xffffffff));
+}
 
-            setReg("$hi", remainder);
-            setReg("$lo", quotient);
+template<class Policy>
+void execDiv(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    int intRs = getRegVal(inst.rs);
+    int intRt = getRegVal(inst.rt);
 
-        }
-        else if(decodedInst[i][0] == "addu") {
-            intRs = getRegVal(decodedInst[i][2]);
-            intRt = getRegVal(decodedInst[i][3]);
+    // If dividing by 0, error.
+    if(intRs == 0 || intRt == 0) {
+        cout << "Error: Cannot divide by 0 on PC " << state.pc << endl;
+        exit(-1);
+    }
 
-            intRd = intRs + intRt;
+    // Sets the remainder and quotient.
+    setReg(REG_HI, intRs % intRt);
+    setReg(REG_LO, intRs / intRt);
+}
 
-            setReg(decodedInst[i][1], intRd);
+template<class Policy>
+void execAddu(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    setReg(inst.rd, getRegVal(inst.rs) + getRegVal(inst.rt));
+}
 
-        }
-        else if(decodedInst[i][0] == "subu") {
-            intRs = getRegVal(decodedInst[i][2]);
-            intRt = getRegVal(decodedInst[i][3]);
+template<class Policy>
+void execSubu(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    setReg(inst.rd, getRegVal(inst.rs) - getRegVal(inst.rt));
+}
 
-            intRd = intRs - intRt;
+template<class Policy>
+void execAnd(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    setReg(inst.rd, getRegVal(inst.rs) & getRegVal(inst.rt));
+}
 
-            setReg(decodedInst[i][1], intRd);
-        }
-        else if(decodedInst[i][0] == "and") {
-            intRs = getRegVal(decodedInst[i][2]);
-            intRt = getRegVal(decodedInst[i][3]);
+template<class Policy>
+void execOr(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    setReg(inst.rd, getRegVal(inst.rs) | getRegVal(inst.rt));
+}
 
-            intRd = (intRs & intRt);
+template<class Policy>
+void execSlt(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    if(getRegVal(inst.rs) < getRegVal(inst.rt)) {
+        setReg(inst.rd, 1);
+    }
+    else {
+        setReg(inst.rd, 0);
+    }
+}
 
-            setReg(decodedInst[i][1], intRd);
-        }
-        else if(decodedInst[i][0] == "or") {
-            intRs = getRegVal(decodedInst[i][2]);
-            intRt = getRegVal(decodedInst[i][3]);
+template<class Policy>
+void execJ(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    // Checks that the PC address is valid.
+    if(inst.immed >= 0 && inst.immed < state.numInst) {
+        state.nextPc = inst.immed;
+    }
+    else {
+        cout << "Error: Invalid Jump Address at PC " << state.pc << endl;
+        exit(-1);
+    }
+}
 
-            intRd = (intRs | intRt);
+// Branches relative to the current PC
+void branch(const decoded_inst &inst, machine_state &state) {
+    int intAddress = state.pc + inst.immed;
 
-            setReg(decodedInst[i][1], intRd);
-        }
-        else if(decodedInst[i][0] == "slt") {
-            intRs = getRegVal(decodedInst[i][2]);
-            intRt = getRegVal(decodedInst[i][3]);
+    // Checks that the PC address is valid.
+    if(intAddress >= 0 && intAddress < state.numInst) {
+        state.nextPc = intAddress;
+    }
+    else {
+        cout << "Error: Invalid Branch Address at PC " << state.pc << endl;
+        exit(-1);
+    }
+}
 
-            if(intRs < intRt) {
-                setReg(decodedInst[i][1], 1);
-            }
-            else {
-                setReg(decodedInst[i][1], 0);
-            }
-        }
-        else if(decodedInst[i][0] == "j") {
-            intAddress = stoi(decodedInst[i][1]);
+template<class Policy>
+void execBeq(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    // Branch if registers are equal
+    if(getRegVal(inst.rs) == getRegVal(inst.rt)) {
+        branch(inst, state);
+    }
+}
 
-            // Checks that the PC address is valid.
-            if(intAddress >= 0 && intAddress < numInst) {
-                i = intAddress - 1;
-            }
-            else {
-                cout << "Error: Invalid Jump Address at PC " << i << endl;
-                exit(-1);
-            }
-        }
-        else if(decodedInst[i][0] == "beq") {
-            intRs = getRegVal(decodedInst[i][1]);
-            intRt = getRegVal(decodedInst[i][2]);
-            intAddress = stoi(decodedInst[i][3]);
+template<class Policy>
+void execBne(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    // Branch if registers are not equal
+    if(getRegVal(inst.rs) != getRegVal(inst.rt)) {
+        branch(inst, state);
+    }
+}
 
-            // Branch if registers are equal
-            if(intRs == intRt) {
-                intAddress = i + intAddress;
+template<class Policy>
+void execAddiu(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    setReg(inst.rt, getRegVal(inst.rs) + inst.immed);
+}
 
-                // Checks that the PC address is valid.
-                if(intAddress >= 0 && intAddress < numInst) {
-                    i = intAddress - 1;
-                }
-                else {
-                    cout << "Error: Invalid Branch Address at PC " << i << endl;
-                    exit(-1);
-                }
-            }
+// Returns the data index of a load/store, exits if it is invalid
+int dataAddress(const decoded_inst &inst, machine_state &state) {
+    // Gets the target data PC address.
+    int intAddress = inst.immed + getRegVal(inst.rs) - state.numInst;
+
+    // Checks that the target address is valid
+    if(intAddress >= state.numData || intAddress < 0) {
+        cout << "Error: Invalid Data Address at PC " << state.pc << endl;
+        exit(-1);
+    }
+
+    return intAddress;
+}
+
+template<class Policy>
+void execLw(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    int index = dataAddress(inst, state);
+    hooks.memRead(state, index + state.numInst, state.dataVec[index]);
+
+    setReg(inst.rt, state.dataVec[index]);
+}
+
+template<class Policy>
+void execSw(const decoded_inst &inst, machine_state &state, Policy &hooks) {
+    int index = dataAddress(inst, state);
+    hooks.memWrite(state, index + state.numInst, getRegVal(inst.rt));
+
+    state.dataVec[index] = getRegVal(inst.rt);
+}
+
+double cpuSeconds() {
+#ifdef _WIN32
+    // clock() is wall time on Windows
+    FILETIME creation, exited, kernel, user;
+    if(!GetProcessTimes(GetCurrentProcess(), &creation, &exited, &kernel, &user)) {
+        return 0;
+    }
+
+    ULARGE_INTEGER kernelTime, userTime;
+    kernelTime.LowPart = kernel.dwLowDateTime;
+    kernelTime.HighPart = kernel.dwHighDateTime;
+    userTime.LowPart = user.dwLowDateTime;
+    userTime.HighPart = user.dwHighDateTime;
+
+    // Counted in 100 nanosecond units
+    return (kernelTime.QuadPart + userTime.QuadPart) / 1e7;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+void startPhase(phase_time &phase) {
+    stats.phase = &phase;
+    stats.timer.wall = chrono::steady_clock::now();
+    stats.timer.cpu = cpuSeconds();
+}
+
+void stopPhase() {
+    if(stats.phase == NULL) {
+        return;
+    }
+
+    stats.phase->wall += chrono::duration<double>(chrono::steady_clock::now() - stats.timer.wall).count();
+    stats.phase->cpu += cpuSeconds() - stats.timer.cpu;
+    stats.phase = NULL;
+}
+
+void printStatsAtExit() {
+    // The simulator failed part way, so finishes the counts here
+    if(stats.exitStatus != 0) {
+        stopPhase();
+
+        if(stats.machine != NULL) {
+            stats.retired = stats.machine->retired;
+            stats.syscalls = stats.machine->syscalls;
         }
-        else if(decodedInst[i][0] == "bne") {
-            intRs = getRegVal(decodedInst[i][1]);
-            intRt = getRegVal(decodedInst[i][2]);
-            intAddress = stoi(decodedInst[i][3]);
 
-            // Branch if registers are not equal
-            if(intRs != intRt) {
-                intAddress = i + intAddress;
+        stats.logBytes = fout ? (long long)fout.tellp() : -1;
+    }
 
-                // Checks that the PC address is valid.
-                if(intAddress >= 0 && intAddress < numInst) {
-                    i = intAddress - 1;
-                }
-                else {
-                    cout << "Error: Invalid Branch Address at PC " << i << endl;
-                    exit(-1);
+    printStats(cerr);
+}
+
+long long peakMemoryKb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize / 1024;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    // Reported in bytes rather than kilobytes
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Prints one phase as a JSON object
+void printPhase(ostream &out, const char *name, const phase_time &phase) {
+    out << "\"" << name << "\":{\"wall_s\":" << phase.wall << ",\"cpu_s\":" << phase.cpu << "}";
+}
+
+void printStats(ostream &out) {
+    // Guest instructions per host second of simulation, not counting input
+    long long instPerSecond = 0;
+    double simulateWall = stats.simulate.wall - stats.inputWall;
+    if(simulateWall > 0) {
+        instPerSecond = llround(stats.retired / simulateWall);
+    }
+
+    // Seconds to the microsecond rather than 6 significant digits
+    ios::fmtflags flags = out.flags();
+    streamsize oldPrecision = out.precision();
+    out << fixed << setprecision(6);
+
+    out << "{\"phases\":{";
+    printPhase(out, "load", stats.load);
+    out << ",";
+    printPhase(out, "decode", stats.decode);
+    out << ",";
+    printPhase(out, "listing", stats.listing);
+    out << ",";
+    printPhase(out, "simulate", stats.simulate);
+    out << ",\"simulate_log\":{\"wall_s\":" << stats.logWall << "},";
+    out << "\"syscall_input\":{\"wall_s\":" << stats.inputWall << "}},";
+    out << "\"instructions\":" << stats.retired << ",";
+    out << "\"instructions_per_second\":" << instPerSecond << ",";
+    out << "\"log_bytes\":";
+    if(stats.logBytes >= 0) {
+        out << stats.logBytes << ",";
+    }
+    else {
+        out << "null,";
+    }
+    out << "\"syscalls\":" << stats.syscalls << ",";
+    out << "\"peak_memory_kb\":" << peakMemoryKb() << ",";
+    out << "\"exit_status\":" << stats.exitStatus;
+
+    if(sampling.period != 0) {
+        out << ",\"sampling\":{\"windows\":" << numWindows() << ",";
+        out << "\"detailed_instructions\":" << sampling.detailed << ",";
+        printEstimate(out, "log_bytes", estimate(sampling.logBytes, sampling.headerBytes + sampling.lastLogBytes));
+        out << ",";
+        printEstimate(out, "simulate_wall_s", estimate(sampling.wall, sampling.lastWall));
+
+        // Instructions of each kind seen in the windows
+        out << ",\"inst_mix\":{";
+        bool first = true;
+        for(int i = 0; i < NUM_INSTS; i++) {
+            sample_estimate est = estimate(windowCounts(i), sampling.lastInstCount[i]);
+            if(est.value > 0) {
+                if(!first) {
+                    out << ",";
                 }
+                printEstimate(out, inst_info::table[i].name, est);
+                first = false;
             }
         }
-        else if(decodedInst[i][0] == "addiu") {
-            intRs = getRegVal(decodedInst[i][2]);
-            intImmed = stoi(decodedInst[i][3]);
+        out << "}}";
+    }
 
-            intRt = intRs + intImmed;
-            setReg(decodedInst[i][1], intRt);
-        }
-        else if(decodedInst[i][0] == "lw") {
-            intAddress = stoi(decodedInst[i][2]);
-            intRs = getRegVal(decodedInst[i][3]);
+    out << "}" << endl;
 
-            // Gets the target data PC address.
-            intAddress = intAddress + intRs;
-            intAddress = intAddress - numInst;
-            
-            // Checks that the target address is valid
-            if(intAddress < numData && intAddress >= 0){
-                setReg(decodedInst[i][1], dataVec[intAddress]);
-            }
-            else {
-                cout << "Error: Invalid Data Address at PC " << i << endl;
-                exit(-1);
-            }
+    out.flags(flags);
+    out.precision(oldPrecision);
+}
 
-        }
-        else if(decodedInst[i][0] == "sw") {
-            intRt = getRegVal(decodedInst[i][1]);
-            intAddress = stoi(decodedInst[i][2]);
-            intRs = getRegVal(decodedInst[i][3]);
+sample_estimate estimate(const vector<double> &totals, double exact) {
+    sample_estimate result = {};
+    result.value = exact;
 
-            // Gets the target data PC address.
-            intAddress = intAddress + intRs;
-            intAddress = intAddress - numInst;
+    // Instructions run outside the final window, of which the full windows are a sample
+    double population = stats.retired - sampling.lastInst;
+    int n = totals.size();
 
-            // Checks that the target address is valid
-            if(intAddress < numData && intAddress >= 0){
-                dataVec[intAddress] = intRt;
-            }
-            else {
-                cout << "Error: Invalid Data Address at PC " << i << endl;
-                exit(-1);
-            }
+    double windowTotal = 0;
+    double instTotal = 0;
+    for(int i = 0; i < n; i++) {
+        windowTotal += totals[i];
+        instTotal += sampling.windowInst[i];
+    }
+
+    // Everything ran in detail, so nothing is estimated
+    if(population <= instTotal) {
+        result.value += windowTotal;
+        result.boundKnown = true;
+        return result;
+    }
+
+    if(n == 0) {
+        return result;
+    }
+
+    // Windows are weighted by their instructions
+    double ratio = windowTotal / instTotal;
+    result.value += ratio * population;
+
+    if(n > 1) {
+        double variance = 0;
+        for(int i = 0; i < n; i++) {
+            double residual = totals[i] - ratio * sampling.windowInst[i];
+            variance += residual * residual;
         }
+        variance /= n - 1;
+
+        // Less of the run is unknown the more of it is detailed
+        double meanInst = instTotal / n;
+        double unsampled = 1 - instTotal / population;
+
+        result.bound = 1.96 * population * sqrt(variance / n * unsampled) / meanInst;
+        result.boundKnown = true;
+    }
+
+    return result;
+}
+
+void printEstimate(ostream &out, const char *name, const sample_estimate &est) {
+    out << "\"" << name << "\":{\"estimate\":" << est.value << ",\"bound\":";
+    if(est.boundKnown) {
+        out << est.bound;
+    }
+    else {
+        out << "null";
+    }
+    out << "}";
+}
+
+void printEstimateLine(ostream &out, const char *name, const sample_estimate &est, int precision) {
+    ios::fmtflags flags = out.flags();
+    streamsize oldPrecision = out.precision();
+
+    out.width(16);
+    out << left << name << fixed << setprecision(precision) << est.value;
+    if(est.boundKnown) {
+        out << " +- " << est.bound;
+    }
+    out << endl;
+
+    out.flags(flags);
+    out.precision(oldPrecision);
+}
+
+vector<double> windowCounts(int id) {
+    vector<double> counts;
+    for(int i = 0; i < sampling.instCount.size(); i++) {
+        counts.push_back(sampling.instCount[i][id]);
+    }
+    return counts;
+}
+
+int numWindows() {
+    return sampling.windowInst.size() + (sampling.lastInst > 0 ? 1 : 0);
+}
+
+void printSampling(ostream &out) {
+    sample_estimate logEst = estimate(sampling.logBytes, sampling.headerBytes + sampling.lastLogBytes);
 
-        printRegs(regs);
-        printAltData(dataVec);
+    out << "Sampled " << sampling.detailed << " of " << stats.retired << " instructions in "
+        << numWindows() << " windows" << endl;
+    if(!logEst.boundKnown) {
+        out << "Too few windows for error bounds" << endl;
+    }
+
+    out << "Estimated for a fully detailed run (95% confidence):" << endl;
+    printEstimateLine(out, "log bytes", logEst, 0);
+    printEstimateLine(out, "seconds", estimate(sampling.wall, sampling.lastWall), 6);
+
+    // Instructions of each kind
+    for(int i = 0; i < NUM_INSTS; i++) {
+        sample_estimate est = estimate(windowCounts(i), sampling.lastInstCount[i]);
+        if(est.value > 0) {
+            printEstimateLine(out, inst_info::table[i].name, est, 0);
+        }
     }
 }
 
@@ -573,37 +1408,63 @@ void printData(vector<int> dataVec, int numInst) {
     fout << "\n";
 }
 
-void printInst(vector<string> inst) {
+void printInst(const decoded_inst &inst, ostream &out) {
+    inst_info::table[inst.id].print(out, inst_info::table[inst.id].name, inst);
+}
 
-    // Special case for lw and sw
-    if(inst[0] == "lw" || inst[0] == "sw") {
-        fout.width(10);
-        fout << left << inst[0];
-        fout << inst[1] << "," << inst[2] << "(" << inst[3] << ")" << endl;
-    }
-    else if(inst[0] == "j") {
-        fout << inst[0] << " " << inst[1] << endl;
-    }
-    else if(inst[0] == "syscall") {
-        fout << inst[0] << endl;
-    }
-    else{
-        fout.width(10);
-        fout << left << inst[0];
+// Syscall
+void printNone(ostream &out, const char *name, const decoded_inst &inst) {
+    out << name << endl;
+}
 
-        for(int j = 1; j < inst.size(); j++) {
-                
-            // If the last register add newline
-            if(j == inst.size()-1){
-                fout << inst[j] << endl;
-            }
-            else {
-                fout << inst[j] << ",";
-            }
-        }
-    }
+// Mfhi and mflo
+void printRd(ostream &out, const char *name, const decoded_inst &inst) {
+    out.width(10);
+    out << left << name;
+    out << registerTable(inst.rd) << endl;
+}
+
+// Mult and div
+void printRsRt(ostream &out, const char *name, const decoded_inst &inst) {
+    out.width(10);
+    out << left << name;
+    out << registerTable(inst.rs) << "," << registerTable(inst.rt) << endl;
+}
+
+// Arithmetic and logical R format
+void printRdRsRt(ostream &out, const char *name, const decoded_inst &inst) {
+    out.width(10);
+    out << left << name;
+    out << registerTable(inst.rd) << "," << registerTable(inst.rs) << ","
+         << registerTable(inst.rt) << endl;
+}
+
+// Branches
+void printRsRtImmed(ostream &out, const char *name, const decoded_inst &inst) {
+    out.width(10);
+    out << left << name;
+    out << registerTable(inst.rs) << "," << registerTable(inst.rt) << ","
+         << inst.immed << endl;
+}
 
-    return;
+// Arithmetic I format
+void printRtRsImmed(ostream &out, const char *name, const decoded_inst &inst) {
+    out.width(10);
+    out << left << name;
+    out << registerTable(inst.rt) << "," << registerTable(inst.rs) << ","
+         << inst.immed << endl;
+}
+
+// Special case for lw and sw
+void printRtImmedRs(ostream &out, const char *name, const decoded_inst &inst) {
+    out.width(10);
+    out << left << name;
+    out << registerTable(inst.rt) << "," << inst.immed << "(" << registerTable(inst.rs) << ")" << endl;
+}
+
+// Jumps
+void printTarget(ostream &out, const char *name, const decoded_inst &inst) {
+    out << name << " " << inst.immed << endl;
 }
 
 
@@ -634,28 +1495,15 @@ void printRegs(vector<pair<string, int>> regs){
 
 }
 
-void setReg(string regName, int regVal){
-    if(regName == "$zero") {
+void setReg(unsigned reg, int regVal){
+    if(reg == REG_ZERO) {
         exit(-1);
     }
-    for(int i = 0; i < regs.size(); i++) {
-        if(regName == regs[i].first) {
-            regs[i].second = regVal;
-        }
-    }
+    regs[reg].second = regVal;
 }
 
-int getRegVal(string regName) {
-    int regVal;
-
-    for(int i = 0; i < regs.size(); i++) {
-        if(regName == regs[i].first) {
-            regVal = regs[i].second;
-            break;
-        }
-    }
-
-    return regVal;
+int getRegVal(unsigned reg) {
+    return regs[reg].second;
 }
 
 // Returns the register name
@@ -729,6 +1577,6 @@ string registerTable(unsigned int registerDec){
         cout << "Error: Invalid register" << endl;
         exit(-1);
     }
-    
+
     return "error";
 }